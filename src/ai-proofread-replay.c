@@ -0,0 +1,390 @@
+/*
+ * Replays API exchanges recorded with AI_PROOFREAD_RECORD from a local HTTP
+ * server, with the original or scaled chunk timing, so that the client can be
+ * benchmarked and regression-tested without network access. Failed transfers
+ * are replayed as such: after the last recorded chunk the connection is
+ * stalled (timeouts) or dropped (other errors).
+ *
+ *   ai-proofread-replay [--scale=F] [--port=N] RECORDING
+ *       Serve RECORDING until interrupted. Point the plugin at it with
+ *       AI_PROOFREAD_API_URL=http://127.0.0.1:N/v1/chat/completions
+ *
+ *   ai-proofread-replay [--scale=F] --prompts=FILE --prompt=NAME --input=FILE RECORDING
+ *       Serve RECORDING and run m_chatgpt_proofread() on the input against
+ *       it, print the result and report how long it took.
+ */
+
+#include <string.h>
+#include <libsoup/soup.h>
+#include <json-glib/json-glib.h>
+
+#include "m-chatgpt-api.h"
+#include "m-transport.h"
+
+struct ReplayContext {
+    JsonObject *recording;
+    gdouble scale;
+};
+
+// How a replayed response ends after its last chunk
+typedef enum {
+    REPLAY_COMPLETE,    // Transfer succeeded: finish the body
+    REPLAY_STALL,       // Transfer timed out: send nothing more
+    REPLAY_DROP         // Transfer failed otherwise: close the connection
+} ReplayEnding;
+
+struct ReplayResponse {
+    SoupServerMessage *msg;
+    JsonArray *chunks;
+    guint index;        // Chunks appended
+    guint written;      // Chunks written to the client
+    guint timeout_id;
+    guint drop_id;
+    gdouble scale;
+    ReplayEnding ending;
+};
+
+struct ClientContext {
+    gchar *content;
+    gchar *prompt_name;
+    JsonArray *prompts;
+    GMainLoop *loop;
+    gboolean success;
+};
+
+static gboolean send_next_chunk(gpointer user_data);
+
+static void
+schedule_next_chunk(struct ReplayResponse *response)
+{
+    JsonObject *chunk;
+    gint64 delay_us = 0;
+
+    if (response->index < json_array_get_length(response->chunks)) {
+        chunk = json_array_get_object_element(response->chunks, response->index);
+        delay_us = json_object_get_int_member_with_default(chunk, "delay_us", 0);
+    }
+    response->timeout_id = g_timeout_add((guint)(delay_us * response->scale / 1000),
+                                         send_next_chunk, response);
+}
+
+static void
+free_response(struct ReplayResponse *response)
+{
+    if (response->timeout_id) {
+        g_source_remove(response->timeout_id);
+    }
+    if (response->drop_id) {
+        g_source_remove(response->drop_id);
+    }
+    json_array_unref(response->chunks);
+    g_object_unref(response->msg);
+    g_free(response);
+}
+
+static gboolean
+drop_connection(gpointer user_data)
+{
+    struct ReplayResponse *response = user_data;
+    GIOStream *stream;
+
+    response->drop_id = 0;
+    g_debug("Dropping connection as recorded");
+
+    g_signal_handlers_disconnect_by_data(response->msg, response);
+    stream = soup_server_message_steal_connection(response->msg);
+    if (stream) {
+        g_io_stream_close(stream, NULL, NULL);
+        g_object_unref(stream);
+    }
+    free_response(response);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+maybe_drop_connection(struct ReplayResponse *response)
+{
+    if (response->ending == REPLAY_DROP && !response->drop_id &&
+        response->written == json_array_get_length(response->chunks)) {
+        response->drop_id = g_idle_add(drop_connection, response);
+    }
+}
+
+static void
+wrote_headers_cb(SoupServerMessage *msg,
+                 gpointer user_data)
+{
+    maybe_drop_connection(user_data);
+}
+
+static void
+wrote_chunk_cb(SoupServerMessage *msg,
+               gpointer user_data)
+{
+    struct ReplayResponse *response = user_data;
+
+    response->written++;
+    maybe_drop_connection(response);
+}
+
+static gboolean
+send_next_chunk(gpointer user_data)
+{
+    struct ReplayResponse *response = user_data;
+    SoupMessageBody *body = soup_server_message_get_response_body(response->msg);
+
+    response->timeout_id = 0;
+
+    if (response->index < json_array_get_length(response->chunks)) {
+        JsonObject *chunk = json_array_get_object_element(response->chunks, response->index++);
+        gsize length;
+        guchar *data = g_base64_decode(json_object_get_string_member(chunk, "data"), &length);
+
+        soup_message_body_append(body, SOUP_MEMORY_TAKE, data, length);
+        schedule_next_chunk(response);
+    } else if (response->ending == REPLAY_COMPLETE) {
+        soup_message_body_complete(body);
+    }
+
+    soup_server_message_unpause(response->msg);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+response_finished_cb(SoupServerMessage *msg,
+                     gpointer user_data)
+{
+    free_response(user_data);
+}
+
+static void
+copy_headers(JsonObject *headers, SoupMessageHeaders *target)
+{
+    GList *names = json_object_get_members(headers);
+
+    for (GList *l = names; l; l = l->next) {
+        const gchar *name = l->data;
+        // Framing is redone by the server
+        if (g_ascii_strcasecmp(name, "Content-Length") == 0 ||
+            g_ascii_strcasecmp(name, "Transfer-Encoding") == 0 ||
+            g_ascii_strcasecmp(name, "Content-Encoding") == 0 ||
+            g_ascii_strcasecmp(name, "Connection") == 0) {
+            continue;
+        }
+        soup_message_headers_append(target, name, json_object_get_string_member(headers, name));
+    }
+    g_list_free(names);
+}
+
+static void
+replay_handler(SoupServer *server,
+               SoupServerMessage *msg,
+               const char *path,
+               GHashTable *query,
+               gpointer user_data)
+{
+    struct ReplayContext *context = user_data;
+    JsonObject *request = json_object_get_object_member(context->recording, "request");
+    JsonObject *recorded = json_object_get_object_member(context->recording, "response");
+    SoupMessageBody *request_body = soup_server_message_get_request_body(msg);
+    SoupMessageHeaders *headers = soup_server_message_get_response_headers(msg);
+    struct ReplayResponse *response;
+    guint status;
+
+    // Flag requests which the client no longer builds the same way
+    if (request && json_object_has_member(request, "body") &&
+        (request_body->length != strlen(json_object_get_string_member(request, "body")) ||
+         memcmp(request_body->data, json_object_get_string_member(request, "body"),
+                request_body->length) != 0)) {
+        g_warning("Request body differs from the recording");
+    }
+
+    response = g_new0(struct ReplayResponse, 1);
+    response->msg = g_object_ref(msg);
+    response->chunks = json_array_ref(json_object_get_array_member(recorded, "chunks"));
+    response->scale = context->scale;
+    if (!json_object_has_member(context->recording, "error")) {
+        response->ending = REPLAY_COMPLETE;
+    } else if (json_object_get_boolean_member_with_default(context->recording, "timed_out", FALSE)) {
+        response->ending = REPLAY_STALL;
+    } else {
+        response->ending = REPLAY_DROP;
+    }
+    g_signal_connect(msg, "finished", G_CALLBACK(response_finished_cb), response);
+    g_signal_connect(msg, "wrote-headers", G_CALLBACK(wrote_headers_cb), response);
+    g_signal_connect(msg, "wrote-chunk", G_CALLBACK(wrote_chunk_cb), response);
+
+    soup_server_message_pause(msg);
+
+    status = json_object_get_int_member_with_default(recorded, "status", 0);
+    if (status == 0) {
+        // No response was received at all, so no status line is sent either
+        g_debug("Recorded transfer failed before the response");
+        if (response->ending != REPLAY_STALL) {
+            response->ending = REPLAY_DROP;
+            response->drop_id = g_idle_add(drop_connection, response);
+        }
+        return;
+    }
+
+    soup_server_message_set_status(msg, status,
+        json_object_get_string_member_with_default(recorded, "reason", NULL));
+    if (json_object_has_member(recorded, "headers")) {
+        copy_headers(json_object_get_object_member(recorded, "headers"), headers);
+    }
+    soup_message_headers_set_encoding(headers, SOUP_ENCODING_CHUNKED);
+
+    schedule_next_chunk(response);
+}
+
+static gboolean
+client_done_cb(gpointer user_data)
+{
+    struct ClientContext *client = user_data;
+
+    g_main_loop_quit(client->loop);
+    return G_SOURCE_REMOVE;
+}
+
+static gpointer
+client_thread(gpointer user_data)
+{
+    struct ClientContext *client = user_data;
+    GError *error = NULL;
+    gint64 start_time = g_get_monotonic_time();
+    gchar *result;
+
+    result = m_chatgpt_proofread(client->content, client->prompt_name,
+                                 client->prompts, "replay", &error);
+
+    g_printerr("Elapsed: %.3f s\n", (g_get_monotonic_time() - start_time) / 1e6);
+    if (error) {
+        g_printerr("Error: %s\n", error->message);
+        g_error_free(error);
+    } else if (result) {
+        g_print("%s\n", result);
+        client->success = TRUE;
+    }
+    g_free(result);
+
+    g_idle_add(client_done_cb, client);
+    return NULL;
+}
+
+static JsonArray *
+load_prompts(const gchar *filename, GError **error)
+{
+    JsonParser *parser = json_parser_new();
+    JsonArray *prompts = NULL;
+
+    if (json_parser_load_from_file(parser, filename, error)) {
+        JsonNode *root = json_parser_get_root(parser);
+        if (JSON_NODE_HOLDS_ARRAY(root)) {
+            prompts = json_array_ref(json_node_get_array(root));
+        } else {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                        "Invalid prompts file %s: root is not an array", filename);
+        }
+    }
+
+    g_object_unref(parser);
+    return prompts;
+}
+
+int
+main(int argc, char **argv)
+{
+    gdouble scale = 1.0;
+    gint port = 0;
+    gchar *prompts_file = NULL, *prompt_name = NULL, *input_file = NULL;
+    GOptionEntry entries[] = {
+        { "scale", 's', 0, G_OPTION_ARG_DOUBLE, &scale, "Multiply recorded delays by F (0 for no delays)", "F" },
+        { "port", 'p', 0, G_OPTION_ARG_INT, &port, "Port to listen on (default: any free port)", "N" },
+        { "prompts", 0, 0, G_OPTION_ARG_FILENAME, &prompts_file, "Prompts file to run the client with", "FILE" },
+        { "prompt", 0, 0, G_OPTION_ARG_STRING, &prompt_name, "Name of the prompt to run", "NAME" },
+        { "input", 0, 0, G_OPTION_ARG_FILENAME, &input_file, "Message text to run the client on", "FILE" },
+        { NULL }
+    };
+    GOptionContext *option_context;
+    struct ReplayContext context = { NULL, 1.0 };
+    SoupServer *server;
+    GMainLoop *loop;
+    GSList *uris;
+    GError *error = NULL;
+    gint status = 0;
+
+    option_context = g_option_context_new("RECORDING");
+    g_option_context_add_main_entries(option_context, entries, NULL);
+    if (!g_option_context_parse(option_context, &argc, &argv, &error) || argc != 2) {
+        g_printerr("%s\n", error ? error->message : "Exactly one recording is required");
+        g_clear_error(&error);
+        g_option_context_free(option_context);
+        return 2;
+    }
+    g_option_context_free(option_context);
+
+    context.recording = m_transport_load_recording(argv[1], &error);
+    if (!context.recording) {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        return 1;
+    }
+    context.scale = MAX(scale, 0.0);
+
+    server = soup_server_new(NULL, NULL);
+    soup_server_add_handler(server, NULL, replay_handler, &context, NULL);
+    if (!soup_server_listen_local(server, port, SOUP_SERVER_LISTEN_IPV4_ONLY, &error)) {
+        g_printerr("Failed to listen: %s\n", error->message);
+        g_error_free(error);
+        return 1;
+    }
+
+    uris = soup_server_get_uris(server);
+    gchar *base_uri = g_uri_to_string(uris->data);
+    gchar *api_url = g_strconcat(base_uri, "v1/chat/completions", NULL);
+    g_slist_free_full(uris, (GDestroyNotify)g_uri_unref);
+    g_free(base_uri);
+
+    loop = g_main_loop_new(NULL, FALSE);
+
+    if (input_file) {
+        struct ClientContext client = { NULL, prompt_name, NULL, loop, FALSE };
+
+        if (!prompts_file || !prompt_name) {
+            g_printerr("--input requires --prompts and --prompt\n");
+            return 2;
+        }
+        client.prompts = load_prompts(prompts_file, &error);
+        if (!client.prompts || !g_file_get_contents(input_file, &client.content, NULL, &error)) {
+            g_printerr("%s\n", error->message);
+            g_error_free(error);
+            return 1;
+        }
+
+        // Must be set before the client thread starts
+        g_setenv("AI_PROOFREAD_API_URL", api_url, TRUE);
+        g_unsetenv(M_TRANSPORT_RECORD_ENV);
+
+        GThread *thread = g_thread_new("replay-client", client_thread, &client);
+        g_main_loop_run(loop);
+        g_thread_join(thread);
+
+        status = client.success ? 0 : 1;
+        json_array_unref(client.prompts);
+        g_free(client.content);
+    } else {
+        g_print("Replaying %s at %s (delay scale %g)\n", argv[1], api_url, context.scale);
+        g_main_loop_run(loop);
+    }
+
+    g_main_loop_unref(loop);
+    g_object_unref(server);
+    json_object_unref(context.recording);
+    g_free(api_url);
+    g_free(prompts_file);
+    g_free(prompt_name);
+    g_free(input_file);
+
+    return status;
+}
@@ -1,13 +1,26 @@
 #include <libsoup/soup.h>
 #include <json-glib/json-glib.h>
 #include "m-chatgpt-api.h"
+#include "m-edit-list.h"
+#include "m-reply-text.h"
+#include "m-usage-stats.h"
+#include "m-transport.h"
 #include "m-version.h"
 
 #define CHATGPT_API_URL "https://api.openai.com/v1/chat/completions"
+
+// Sent with excerpts so that the result can be spliced back in place
+#define EXCERPT_INSTRUCTION \
+    "The input is an excerpt from the middle of a longer email, not the " \
+    "whole email. Correct only this excerpt and return it with the same " \
+    "beginning and end. Do not add a greeting, complimentary close, " \
+    "signature or any other text."
+
+#define CHATGPT_API_URL_ENV "AI_PROOFREAD_API_URL"
 #define CHATGPT_API_USER_AGENT "Evolution-AI-Proofread/" AI_PROOFREAD_VERSION " (" AI_PROOFREAD_URL ")"
 
-static const gchar *
-find_prompt_text(JsonArray *prompts, const gchar *prompt_id)
+JsonObject *
+m_chatgpt_find_prompt(JsonArray *prompts, const gchar *prompt_id)
 {
     guint length = json_array_get_length(prompts);
     // Strip "ai-proofread-" prefix from prompt_id
@@ -19,18 +32,41 @@ find_prompt_text(JsonArray *prompts, const gchar *prompt_id)
     for (guint i = 0; i < length; i++) {
         JsonObject *prompt = json_array_get_object_element(prompts, i);
         if (g_strcmp0(json_object_get_string_member(prompt, "name"), name) == 0) {
-            return json_object_get_string_member(prompt, "prompt");
+            return prompt;
         }
     }
     return NULL;
 }
 
-gchar *
-m_chatgpt_proofread(const gchar *content,
-                    const gchar *prompt_id,
-                    JsonArray *prompts,
-                    const gchar *api_key,
-                    GError **error)
+/*
+ * Near-identity prompts (proofreading) return mostly the input text, so the
+ * author's part of it is passed as a predicted output which the API can
+ * accept in bulk.
+ */
+static gboolean
+prompt_wants_prediction(JsonObject *prompt)
+{
+    return json_object_get_boolean_member_with_default(prompt, "near_identity", FALSE);
+}
+
+static void
+add_system_message(JsonBuilder *builder, const gchar *text)
+{
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "role");
+    json_builder_add_string_value(builder, "system");
+    json_builder_set_member_name(builder, "content");
+    json_builder_add_string_value(builder, text);
+    json_builder_end_object(builder);
+}
+
+static gchar *
+chatgpt_request(const gchar *content,
+                const gchar *prompt_id,
+                JsonArray *prompts,
+                const gchar *api_key,
+                gboolean excerpt,
+                GError **error)
 {
     SoupSession *session;
     SoupMessage *msg;
@@ -38,31 +74,47 @@ m_chatgpt_proofread(const gchar *content,
     JsonGenerator *generator;
     JsonNode *root;
     gchar *json_data;
-    const gchar *prompt_text;
+    JsonObject *prompt;
+    const gchar *prompt_text = NULL;
     gchar *response_text = NULL;
+    gboolean edit_list;
     
-    prompt_text = find_prompt_text(prompts, prompt_id);
+    prompt = m_chatgpt_find_prompt(prompts, prompt_id);
+    if (prompt) {
+        prompt_text = json_object_get_string_member(prompt, "prompt");
+    }
     if (!prompt_text) {
         g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
                    "Prompt not found for ID: %s", prompt_id);
         return NULL;
     }
+    edit_list = m_edit_list_wanted(prompt);
 
-    // Build request JSON
+    /*
+     * Build request JSON. Everything up to the user message depends only on
+     * the prompt, so it serialises to the same bytes on every call and can be
+     * served from the provider's prompt cache. Keep per-message data last.
+     */
     builder = json_builder_new();
     json_builder_begin_object(builder);
     json_builder_set_member_name(builder, "model");
     json_builder_add_string_value(builder, "gpt-4o");
+    json_builder_set_member_name(builder, "prompt_cache_key");
+    gchar *cache_key = g_strdup_printf("ai-proofread-%s",
+                                       json_object_get_string_member(prompt, "name"));
+    json_builder_add_string_value(builder, cache_key);
+    g_free(cache_key);
     json_builder_set_member_name(builder, "messages");
     json_builder_begin_array(builder);
     
-    // System message with prompt
-    json_builder_begin_object(builder);
-    json_builder_set_member_name(builder, "role");
-    json_builder_add_string_value(builder, "system");
-    json_builder_set_member_name(builder, "content");
-    json_builder_add_string_value(builder, prompt_text);
-    json_builder_end_object(builder);
+    // System message with prompt, plus the edit-list and excerpt instructions if any
+    add_system_message(builder, prompt_text);
+    if (edit_list) {
+        add_system_message(builder, m_edit_list_get_instruction());
+    }
+    if (excerpt) {
+        add_system_message(builder, EXCERPT_INSTRUCTION);
+    }
     
     // User message with content
     json_builder_begin_object(builder);
@@ -73,6 +125,27 @@ m_chatgpt_proofread(const gchar *content,
     json_builder_end_object(builder);
     
     json_builder_end_array(builder);
+
+    if (edit_list) {
+        m_edit_list_add_request_members(builder);
+    } else if (prompt_wants_prediction(prompt)) {
+        /*
+         * Predict only what the model is asked to return: an excerpt as is,
+         * otherwise the author's text without the quote (or its summary) and
+         * the signature, which would only add rejected prediction tokens.
+         */
+        gchar *prediction = excerpt ? g_strdup(content) : m_reply_text_get_author_text(content);
+        if (*prediction) {
+            json_builder_set_member_name(builder, "prediction");
+            json_builder_begin_object(builder);
+            json_builder_set_member_name(builder, "type");
+            json_builder_add_string_value(builder, "content");
+            json_builder_set_member_name(builder, "content");
+            json_builder_add_string_value(builder, prediction);
+            json_builder_end_object(builder);
+        }
+        g_free(prediction);
+    }
     json_builder_end_object(builder);
 
     // Generate JSON string
@@ -88,10 +161,16 @@ m_chatgpt_proofread(const gchar *content,
         "idle-timeout", 0,
         NULL);
     
-    msg = soup_message_new("POST", CHATGPT_API_URL);
+    // The endpoint can be overridden, e.g. to point at a replay server
+    const gchar *api_url = g_getenv(CHATGPT_API_URL_ENV);
+    if (!api_url || !*api_url) {
+        api_url = CHATGPT_API_URL;
+    }
+
+    msg = soup_message_new("POST", api_url);
     if (!msg) {
         g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                    "Failed to create HTTP message for URL: %s", CHATGPT_API_URL);
+                    "Failed to create HTTP message for URL: %s", api_url);
         g_object_unref(session);
         return NULL;
     }
@@ -114,15 +193,21 @@ m_chatgpt_proofread(const gchar *content,
     GBytes *response = NULL;
     GError *local_error = NULL;
     
-    g_debug("Sending request to %s", CHATGPT_API_URL);
-    response = soup_session_send_and_read(session, msg, NULL, &local_error);
+    g_debug("Sending request to %s", api_url);
+    gint64 start_time = g_get_monotonic_time();
+    response = m_transport_send(session, msg, json_data, &local_error);
+    gint64 elapsed_us = g_get_monotonic_time() - start_time;
     
     // Check HTTP status code
     guint status_code = soup_message_get_status(msg);
     const char *reason = soup_message_get_reason_phrase(msg);
     g_debug("HTTP Status: %d %s", status_code, reason ? reason : "Unknown");
     
-    if (SOUP_STATUS_IS_SUCCESSFUL(status_code)) {
+    // A failed transfer (no response at all, or one cut off) wins over the status
+    if (local_error) {
+        g_propagate_error(error, local_error);
+        goto cleanup;
+    } else if (SOUP_STATUS_IS_SUCCESSFUL(status_code)) {
         g_debug("HTTP request successful with status %d", status_code);
     } else {
         const char *response_body = "";
@@ -184,7 +269,18 @@ m_chatgpt_proofread(const gchar *content,
                     return NULL;
                 }
                 
-                response_text = g_strdup(json_object_get_string_member(message, "content"));
+                JsonNode *usage = json_object_get_member(obj, "usage");
+                m_usage_stats_record(json_object_get_string_member(prompt, "name"),
+                                     usage && JSON_NODE_HOLDS_OBJECT(usage) ?
+                                         json_node_get_object(usage) : NULL,
+                                     elapsed_us);
+
+                const gchar *message_content = json_object_get_string_member(message, "content");
+                if (edit_list) {
+                    response_text = m_edit_list_apply(content, message_content, error);
+                } else {
+                    response_text = g_strdup(message_content);
+                }
             }
         } else {
             if (!*error) {
@@ -195,8 +291,6 @@ m_chatgpt_proofread(const gchar *content,
         
         g_object_unref(parser);
         g_bytes_unref(response);
-    } else if (local_error) {
-        g_propagate_error(error, local_error);
     } else {
         if (!*error) {
             g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
@@ -218,4 +312,28 @@ cleanup:
     g_object_unref(msg);
 
     return response_text;
-} 
\ No newline at end of file
+} 
+
+gchar *
+m_chatgpt_proofread(const gchar *content,
+                    const gchar *prompt_id,
+                    JsonArray *prompts,
+                    const gchar *api_key,
+                    GError **error)
+{
+    return chatgpt_request(content, prompt_id, prompts, api_key, FALSE, error);
+}
+
+/*
+ * Like m_chatgpt_proofread(), but the content is an excerpt of a longer
+ * message which the caller splices the result back into.
+ */
+gchar *
+m_chatgpt_proofread_excerpt(const gchar *content,
+                            const gchar *prompt_id,
+                            JsonArray *prompts,
+                            const gchar *api_key,
+                            GError **error)
+{
+    return chatgpt_request(content, prompt_id, prompts, api_key, TRUE, error);
+}
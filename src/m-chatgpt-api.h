@@ -3,10 +3,19 @@
 
 #include <json-glib/json-glib.h>
 
+JsonObject *m_chatgpt_find_prompt(JsonArray *prompts,
+                                  const gchar *prompt_id);
+
 gchar *m_chatgpt_proofread(const gchar *content, 
                           const gchar *prompt_id,
                           JsonArray *prompts,
                           const gchar *api_key,
                           GError **error);
 
+gchar *m_chatgpt_proofread_excerpt(const gchar *content,
+                                   const gchar *prompt_id,
+                                   JsonArray *prompts,
+                                   const gchar *api_key,
+                                   GError **error);
+
 #endif /* M_CHATGPT_API_H */ 
\ No newline at end of file
@@ -0,0 +1,200 @@
+#include <string.h>
+#include <gio/gio.h>
+#include "m-edit-list.h"
+
+#define EDIT_LIST_INSTRUCTION \
+    "Do not return the corrected text. Instead return the list of edits " \
+    "needed to turn the input into the corrected text, in the order they " \
+    "appear in the input. For each edit give \"original\": the exact text " \
+    "to replace, copied verbatim from the input; \"replacement\": the text " \
+    "to put in its place; and \"before\": up to five words immediately " \
+    "preceding \"original\", copied verbatim from the input (empty at the " \
+    "very start), so that the location is unambiguous. To insert text at " \
+    "the very start, leave both \"before\" and \"original\" empty. " \
+    "\"before\" and \"original\" must consist of whole words: never start " \
+    "or end them in the middle of a word. To correct part of a word, " \
+    "replace the whole word (\"recieve\" with \"receive\", not \"ie\" with " \
+    "\"ei\"). Otherwise keep each edit as small as possible. Return an " \
+    "empty list if nothing needs changing."
+
+// Strict JSON schema for the structured output, see response_format
+#define EDIT_LIST_SCHEMA \
+    "{" \
+    "  \"type\": \"object\"," \
+    "  \"additionalProperties\": false," \
+    "  \"required\": [\"edits\"]," \
+    "  \"properties\": {" \
+    "    \"edits\": {" \
+    "      \"type\": \"array\"," \
+    "      \"items\": {" \
+    "        \"type\": \"object\"," \
+    "        \"additionalProperties\": false," \
+    "        \"required\": [\"before\", \"original\", \"replacement\"]," \
+    "        \"properties\": {" \
+    "          \"before\": {\"type\": \"string\"}," \
+    "          \"original\": {\"type\": \"string\"}," \
+    "          \"replacement\": {\"type\": \"string\"}" \
+    "        }" \
+    "      }" \
+    "    }" \
+    "  }" \
+    "}"
+
+gboolean
+m_edit_list_wanted(JsonObject *prompt)
+{
+    return prompt &&
+           g_strcmp0(json_object_get_string_member_with_default(prompt, "response", NULL),
+                     "edits") == 0;
+}
+
+const gchar *
+m_edit_list_get_instruction(void)
+{
+    return EDIT_LIST_INSTRUCTION;
+}
+
+/*
+ * Adds the "response_format" member constraining the reply to an edit list.
+ * The builder must be inside the request object.
+ */
+void
+m_edit_list_add_request_members(JsonBuilder *builder)
+{
+    JsonNode *schema = json_from_string(EDIT_LIST_SCHEMA, NULL);
+
+    g_return_if_fail(schema != NULL);
+
+    json_builder_set_member_name(builder, "response_format");
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "type");
+    json_builder_add_string_value(builder, "json_schema");
+    json_builder_set_member_name(builder, "json_schema");
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "name");
+    json_builder_add_string_value(builder, "proofread_edits");
+    json_builder_set_member_name(builder, "strict");
+    json_builder_add_boolean_value(builder, TRUE);
+    json_builder_set_member_name(builder, "schema");
+    json_builder_add_value(builder, schema);  // Takes ownership
+    json_builder_end_object(builder);
+    json_builder_end_object(builder);
+}
+
+// TRUE unless pos is between two letters or digits of the same word
+static gboolean
+is_word_boundary(const gchar *text, const gchar *pos)
+{
+    if (pos == text || *pos == '\0') {
+        return TRUE;
+    }
+    return !g_unichar_isalnum(g_utf8_get_char(g_utf8_prev_char(pos))) ||
+           !g_unichar_isalnum(g_utf8_get_char(pos));
+}
+
+/*
+ * Applies the edits to the original text. Edits are located by searching for
+ * "before" + "original" as whole words after the previous edit, so they must
+ * come in document order and must not overlap. If any edit does not match, the
+ * whole list is rejected rather than producing a half-corrected message.
+ */
+gchar *
+m_edit_list_apply(const gchar *text,
+                  const gchar *edits_json,
+                  GError **error)
+{
+    JsonParser *parser;
+    JsonNode *root;
+    JsonArray *edits;
+    GString *result;
+    const gchar *cursor = text;
+    const gchar *last_match = text;
+    guint i, n_edits;
+
+    if (!edits_json) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "Invalid edit list: empty response");
+        return NULL;
+    }
+
+    parser = json_parser_new();
+    if (!json_parser_load_from_data(parser, edits_json, -1, error)) {
+        g_object_unref(parser);
+        return NULL;
+    }
+
+    root = json_parser_get_root(parser);
+    if (!JSON_NODE_HOLDS_OBJECT(root) ||
+        !json_object_has_member(json_node_get_object(root), "edits") ||
+        !JSON_NODE_HOLDS_ARRAY(json_object_get_member(json_node_get_object(root), "edits"))) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "Invalid edit list: no 'edits' array");
+        g_object_unref(parser);
+        return NULL;
+    }
+
+    edits = json_object_get_array_member(json_node_get_object(root), "edits");
+    n_edits = json_array_get_length(edits);
+    g_debug("Applying %u edits", n_edits);
+
+    result = g_string_sized_new(strlen(text) + 64);
+    for (i = 0; i < n_edits; i++) {
+        JsonObject *edit = json_array_get_object_element(edits, i);
+        const gchar *before, *original, *replacement;
+        gchar *anchor;
+        const gchar *match;
+
+        before = edit ? json_object_get_string_member_with_default(edit, "before", NULL) : NULL;
+        original = edit ? json_object_get_string_member_with_default(edit, "original", NULL) : NULL;
+        replacement = edit ? json_object_get_string_member_with_default(edit, "replacement", NULL) : NULL;
+
+        if (!before || !original || !replacement) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                        "Invalid edit list: edit %u is malformed", i);
+            g_string_free(result, TRUE);
+            g_object_unref(parser);
+            return NULL;
+        }
+
+        /*
+         * The anchor may reach back into the text replaced by the previous
+         * edit, so search from where that edit started. An edit with empty
+         * "before" and "original" inserts at the very start of the text.
+         */
+        if (!*before && !*original) {
+            match = cursor == text ? text : NULL;
+        } else {
+            anchor = g_strconcat(before, original, NULL);
+            match = strstr(last_match, anchor);
+            while (match && (match + strlen(before) < cursor ||
+                             !is_word_boundary(text, match) ||
+                             !is_word_boundary(text, match + strlen(anchor)))) {
+                match = strstr(match + 1, anchor);
+            }
+            g_free(anchor);
+
+            if (match) {
+                match += strlen(before);
+            }
+        }
+
+        if (!match) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                        "Invalid edit list: edit %u (\"%s\") does not match the original text",
+                        i, original);
+            g_string_free(result, TRUE);
+            g_object_unref(parser);
+            return NULL;
+        }
+
+        last_match = match;
+        g_string_append_len(result, cursor, match - cursor);
+        g_string_append(result, replacement);
+        cursor = match + strlen(original);
+    }
+    g_string_append(result, cursor);
+
+    g_object_unref(parser);
+
+    return g_string_free(result, FALSE);
+}
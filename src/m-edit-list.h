@@ -0,0 +1,16 @@
+#ifndef M_EDIT_LIST_H
+#define M_EDIT_LIST_H
+
+#include <json-glib/json-glib.h>
+
+gboolean m_edit_list_wanted(JsonObject *prompt);
+
+void m_edit_list_add_request_members(JsonBuilder *builder);
+
+const gchar *m_edit_list_get_instruction(void);
+
+gchar *m_edit_list_apply(const gchar *text,
+                         const gchar *edits_json,
+                         GError **error);
+
+#endif /* M_EDIT_LIST_H */
@@ -11,6 +11,11 @@
 
 #include "m-msg-composer-extension.h"
 #include "m-chatgpt-api.h"
+#include "m-spell-prefilter.h"
+#include "m-edit-list.h"
+#include "m-reply-text.h"
+#include "m-usage-stats.h"
+#include "m-thread-summary.h"
 
 
 struct _MMsgComposerExtensionPrivate {
@@ -103,6 +108,54 @@ load_api_key(void)
     return api_key;
 }
 
+/*
+ * Message-IDs of the thread being replied to, from the root to the message
+ * replied to: References, followed by In-Reply-To if it is not the last
+ * entry already. NULL for a new message.
+ */
+static gchar **
+get_thread_references (EMsgComposer *composer)
+{
+    const gchar *references = e_msg_composer_get_header(composer, "References", 0);
+    const gchar *in_reply_to = e_msg_composer_get_header(composer, "In-Reply-To", 0);
+    GPtrArray *ids = g_ptr_array_new();
+    gchar *reply_id;
+
+    if (references) {
+        gchar **tokens = g_strsplit_set(references, " \t\r\n", -1);
+        for (gint i = 0; tokens[i]; i++) {
+            if (*tokens[i]) {
+                g_ptr_array_add(ids, g_strdup(tokens[i]));
+            }
+        }
+        g_strfreev(tokens);
+    }
+
+    if (in_reply_to && *in_reply_to) {
+        reply_id = g_strstrip(g_strdup(in_reply_to));
+        if (ids->len == 0 || g_strcmp0(g_ptr_array_index(ids, ids->len - 1), reply_id) != 0) {
+            g_ptr_array_add(ids, reply_id);
+        } else {
+            g_free(reply_id);
+        }
+    }
+
+    if (ids->len == 0) {
+        g_ptr_array_free(ids, TRUE);
+        return NULL;
+    }
+    g_ptr_array_add(ids, NULL);
+    return (gchar **)g_ptr_array_free(ids, FALSE);
+}
+
+static gboolean
+check_word_cb (const gchar *word,
+               gsize length,
+               gpointer user_data)
+{
+    return e_spell_checker_check_word(E_SPELL_CHECKER(user_data), word, length);
+}
+
 static void
 msg_text_cb (GObject *source_object,
              GAsyncResult *result,
@@ -136,13 +189,105 @@ msg_text_cb (GObject *source_object,
         E_CONTENT_EDITOR_GET_TO_SEND_PLAIN, NULL);
     
     if (content) {
-        gchar *proofread_text = m_chatgpt_proofread(
-            content,
-            prompt_id,
-            extension->priv->prompts,
-            extension->priv->chatgpt_api_key,
-            &error
-        );
+        JsonObject *prompt = m_chatgpt_find_prompt(extension->priv->prompts, prompt_id);
+        MSpellPrefilterMode prefilter = m_spell_prefilter_get_mode(prompt);
+        gsize block_start = 0, block_end = 0;
+        gsize span_start = 0, span_end = strlen(content);
+        gboolean narrowed = FALSE;
+        gboolean edit_list = m_edit_list_wanted(prompt);
+
+        if (prefilter != M_SPELL_PREFILTER_OFF) {
+            ESpellChecker *checker = e_content_editor_ref_spell_checker(cnt_editor);
+
+            if (checker && e_spell_checker_count_active_languages(checker) > 0) {
+                MSpellPrefilterResult found = m_spell_prefilter_find_span(
+                    check_word_cb, checker, content, &block_start, &block_end, &span_start, &span_end);
+
+                if (found == M_SPELL_PREFILTER_CLEAN) {
+                    g_debug("No misspelt words found, skipping API call");
+                    g_object_unref(checker);
+
+                    EMsgComposer *composer = E_MSG_COMPOSER(
+                        e_extension_get_extensible(E_EXTENSION(extension)));
+
+                    GtkWidget *dialog = gtk_message_dialog_new(
+                        GTK_WINDOW(composer),
+                        GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+                        GTK_MESSAGE_INFO,
+                        GTK_BUTTONS_OK,
+                        _("No spelling mistakes found, nothing was sent for proofreading"));
+
+                    gtk_dialog_run(GTK_DIALOG(dialog));
+                    gtk_widget_destroy(dialog);
+
+                    g_free(content);
+                    e_content_editor_util_free_content_hash (content_hash);
+                    g_free(context);
+                    return;
+                }
+                narrowed = prefilter == M_SPELL_PREFILTER_NARROW &&
+                           found == M_SPELL_PREFILTER_FOUND;
+            } else {
+                g_debug("No spell-check languages active, prefilter disabled");
+            }
+            g_clear_object(&checker);
+        }
+
+        /*
+         * Otherwise the whole message is sent, except with edits: they are
+         * applied to the text sent, so send only the author's text unless it
+         * is interleaved with the quote.
+         */
+        if (!narrowed &&
+            (!edit_list || !m_reply_text_find_author_block(content, &span_start, &span_end))) {
+            span_start = 0;
+            span_end = strlen(content);
+        }
+
+        gchar *request_text = g_strndup(content + span_start, span_end - span_start);
+
+        // Send a cached summary of the quoted thread instead of the quote itself
+        if (m_thread_summary_wanted(prompt)) {
+            EMsgComposer *composer = E_MSG_COMPOSER(
+                e_extension_get_extensible(E_EXTENSION(extension)));
+            gchar **references = get_thread_references(composer);
+            gchar *condensed = m_thread_summary_condense(
+                request_text, (const gchar * const *)references,
+                extension->priv->chatgpt_api_key, &error);
+
+            if (condensed) {
+                g_free(request_text);
+                request_text = condensed;
+            } else {
+                // Fall back to sending the quote as is
+                g_warning("Error summarising thread: %s",
+                          error ? error->message : "no response");
+                g_clear_error(&error);
+            }
+            g_strfreev(references);
+        }
+        g_debug("Sending %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " bytes",
+                strlen(request_text), strlen(content));
+
+        gchar *proofread_text;
+        if (narrowed) {
+            proofread_text = m_chatgpt_proofread_excerpt(
+                request_text,
+                prompt_id,
+                extension->priv->prompts,
+                extension->priv->chatgpt_api_key,
+                &error
+            );
+        } else {
+            proofread_text = m_chatgpt_proofread(
+                request_text,
+                prompt_id,
+                extension->priv->prompts,
+                extension->priv->chatgpt_api_key,
+                &error
+            );
+        }
+        g_free(request_text);
 
         if (error) {
             g_warning("ChatGPT API error: %s", error->message);
@@ -159,6 +304,25 @@ msg_text_cb (GObject *source_object,
             g_error_free(error);
             g_free(context);
             return;
+        } else if (proofread_text && narrowed) {
+            /*
+             * Splice the excerpt back into the author's block around it.
+             * Quotes and signature are left out, as they are in the reply
+             * to a whole message.
+             */
+            gchar *before = g_strndup(content + block_start, span_start - block_start);
+            gchar *after = g_strndup(content + span_end, block_end - span_end);
+            new_content = g_strconcat(before, proofread_text, after, NULL);
+            g_free(before);
+            g_free(after);
+            g_free(proofread_text);
+        } else if (proofread_text && edit_list) {
+            /*
+             * Edits leave any quote and signature sent (for an inline reply)
+             * in place. Leave them out, as the model does in text mode.
+             */
+            new_content = m_reply_text_get_author_text(proofread_text);
+            g_free(proofread_text);
         } else if (proofread_text) {
             new_content = g_strdup(proofread_text);
             g_free(proofread_text);
@@ -446,6 +610,14 @@ m_msg_composer_extension_init (MMsgComposerExtension *msg_composer_ext)
 	msg_composer_ext->priv = m_msg_composer_extension_get_instance_private (msg_composer_ext);
 	msg_composer_ext->priv->prompts = load_prompts();
 	msg_composer_ext->priv->chatgpt_api_key = load_api_key();
+
+	gchar *stats_path = g_build_filename(e_get_user_data_dir(), "ai-proofread", "stats.json", NULL);
+	m_usage_stats_set_filename(stats_path);
+	g_free(stats_path);
+
+	gchar *summary_dir = g_build_filename(e_get_user_cache_dir(), "ai-proofread", "threads", NULL);
+	m_thread_summary_set_cache_dir(summary_dir);
+	g_free(summary_dir);
 }
 
 static void
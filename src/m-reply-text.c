@@ -0,0 +1,166 @@
+#include <string.h>
+#include "m-reply-text.h"
+
+/*
+ * Structure of a plain-text reply from the composer: the author's own lines,
+ * quoted lines (starting with '>') each introduced by an attribution line
+ * ("On ..., X wrote:"), and the signature after the "-- " separator.
+ */
+
+static const gchar *
+next_line(const gchar *line, const gchar *end)
+{
+    const gchar *eol = memchr(line, '\n', end - line);
+    return eol ? eol + 1 : end;
+}
+
+static gboolean
+is_blank_line(const gchar *line, const gchar *end)
+{
+    while (line < end && *line != '\n') {
+        if (!g_ascii_isspace(*line)) {
+            return FALSE;
+        }
+        line++;
+    }
+    return TRUE;
+}
+
+// A line ending in ':' with only blank lines between it and a quote
+static gboolean
+is_attribution(const gchar *line, const gchar *end)
+{
+    const gchar *next = next_line(line, end);
+    const gchar *p = next;
+
+    while (p > line && g_ascii_isspace(p[-1])) {
+        p--;
+    }
+    if (p == line || p[-1] != ':') {
+        return FALSE;
+    }
+
+    while (next < end && is_blank_line(next, end)) {
+        next = next_line(next, end);
+    }
+    return next < end && *next == '>';
+}
+
+// Offset of the signature separator line, or the length of the text
+gsize
+m_reply_text_find_signature(const gchar *text)
+{
+    const gchar *end = text + strlen(text);
+    const gchar *line;
+
+    for (line = text; line < end; line = next_line(line, end)) {
+        if (g_str_has_prefix(line, "-- \n") || g_str_has_prefix(line, "-- \r\n") ||
+            g_strcmp0(line, "-- ") == 0) {
+            break;
+        }
+    }
+    return line - text;
+}
+
+/*
+ * End of the author's block of lines starting at block_start: the next quoted
+ * line, or stop. A trailing attribution line introducing the quote and
+ * surrounding whitespace are not part of the block.
+ */
+gsize
+m_reply_text_find_block_end(const gchar *text, gsize block_start, gsize stop)
+{
+    const gchar *line = text + block_start;
+    const gchar *end = text + stop;
+    gboolean quoted = FALSE;
+    const gchar *last_line;
+
+    while (line < end && *line != '>') {
+        line = next_line(line, end);
+    }
+    quoted = line < end;
+
+    while (line > text + block_start && g_ascii_isspace(line[-1])) {
+        line--;
+    }
+
+    if (quoted && line > text + block_start && line[-1] == ':') {
+        last_line = line - 1;
+        while (last_line > text + block_start && last_line[-1] != '\n') {
+            last_line--;
+        }
+        line = last_line;
+        while (line > text + block_start && g_ascii_isspace(line[-1])) {
+            line--;
+        }
+    }
+
+    return line - text;
+}
+
+/*
+ * Finds the author's text of a new message or of a reply written above or
+ * below the quote. Returns FALSE if there is no text of the author's, or if
+ * it is interleaved with the quote (an inline reply).
+ */
+gboolean
+m_reply_text_find_author_block(const gchar *text,
+                               gsize *block_start,
+                               gsize *block_end)
+{
+    gsize stop = m_reply_text_find_signature(text);
+    const gchar *end = text + stop;
+    const gchar *first = NULL;
+    gboolean after_first_quote = FALSE;
+
+    for (const gchar *line = text; line < end; line = next_line(line, end)) {
+        if (*line == '>') {
+            after_first_quote = first != NULL;
+        } else if (!is_blank_line(line, end) && !is_attribution(line, end)) {
+            if (!first) {
+                first = line;
+            } else if (after_first_quote) {
+                g_debug("Inline reply, no single block of the author's text");
+                return FALSE;
+            }
+        }
+    }
+
+    if (!first) {
+        return FALSE;
+    }
+
+    *block_start = first - text;
+    *block_end = m_reply_text_find_block_end(text, *block_start, stop);
+    return TRUE;
+}
+
+/*
+ * Returns the author's lines only, without quoted lines, attribution lines
+ * and the signature, and without leading or trailing whitespace.
+ */
+gchar *
+m_reply_text_get_author_text(const gchar *text)
+{
+    const gchar *end = text + m_reply_text_find_signature(text);
+    GString *result = g_string_sized_new(end - text);
+    gsize start = 0;
+
+    for (const gchar *line = text; line < end; ) {
+        const gchar *next = next_line(line, end);
+        if (*line != '>' && !is_attribution(line, end)) {
+            g_string_append_len(result, line, next - line);
+        }
+        line = next;
+    }
+
+    while (start < result->len && g_ascii_isspace(result->str[start])) {
+        start++;
+    }
+    g_string_erase(result, 0, start);
+    while (result->len > 0 && g_ascii_isspace(result->str[result->len - 1])) {
+        g_string_truncate(result, result->len - 1);
+    }
+
+    return g_string_free(result, FALSE);
+}
@@ -0,0 +1,16 @@
+#ifndef M_REPLY_TEXT_H
+#define M_REPLY_TEXT_H
+
+#include <glib.h>
+
+gsize m_reply_text_find_signature(const gchar *text);
+
+gsize m_reply_text_find_block_end(const gchar *text, gsize block_start, gsize stop);
+
+gboolean m_reply_text_find_author_block(const gchar *text,
+                                        gsize *block_start,
+                                        gsize *block_end);
+
+gchar *m_reply_text_get_author_text(const gchar *text);
+
+#endif /* M_REPLY_TEXT_H */
@@ -0,0 +1,278 @@
+#include <string.h>
+#include "m-spell-prefilter.h"
+#include "m-reply-text.h"
+
+MSpellPrefilterMode
+m_spell_prefilter_get_mode(JsonObject *prompt)
+{
+    const gchar *mode;
+
+    if (!prompt || !json_object_has_member(prompt, "prefilter")) {
+        return M_SPELL_PREFILTER_OFF;
+    }
+
+    mode = json_object_get_string_member(prompt, "prefilter");
+    if (g_strcmp0(mode, "skip") == 0) {
+        return M_SPELL_PREFILTER_SKIP;
+    } else if (g_strcmp0(mode, "narrow") == 0) {
+        return M_SPELL_PREFILTER_NARROW;
+    }
+
+    if (g_strcmp0(mode, "off") != 0) {
+        g_warning("Unknown prefilter mode: %s", mode ? mode : "(null)");
+    }
+    return M_SPELL_PREFILTER_OFF;
+}
+
+static gboolean
+is_word_char(gunichar c)
+{
+    // Apostrophes and hyphens are allowed inside words ("don't", "e-mail")
+    return g_unichar_isalpha(c) || c == '\'' || c == 0x2019 || c == '-';
+}
+
+static gboolean
+check_part(MSpellCheckFunc check_word, gpointer user_data, const gchar *start, const gchar *end)
+{
+    // Single letters are never worth a round-trip
+    if (g_utf8_strlen(start, end - start) < 2) {
+        return TRUE;
+    }
+    return check_word(start, end - start, user_data);
+}
+
+/*
+ * Checks a whitespace-delimited token. Surrounding punctuation is stripped;
+ * tokens containing digits or other symbols (URLs, addresses, numbers,
+ * identifiers) are not checked at all.
+ */
+static gboolean
+check_token(MSpellCheckFunc check_word,
+            gpointer user_data,
+            const gchar *start,
+            const gchar *end,
+            const gchar **word_start,
+            const gchar **word_end)
+{
+    const gchar *p;
+
+    while (start < end && !g_unichar_isalnum(g_utf8_get_char(start))) {
+        start = g_utf8_next_char(start);
+    }
+    while (end > start) {
+        const gchar *prev = g_utf8_prev_char(end);
+        if (g_unichar_isalnum(g_utf8_get_char(prev))) {
+            break;
+        }
+        end = prev;
+    }
+    if (start == end) {
+        return TRUE;
+    }
+
+    for (p = start; p < end; p = g_utf8_next_char(p)) {
+        if (!is_word_char(g_utf8_get_char(p))) {
+            return TRUE;
+        }
+    }
+
+    *word_start = start;
+    *word_end = end;
+
+    // Check each part of a hyphenated compound separately
+    for (p = start; p < end; ) {
+        const gchar *part_end = p;
+        while (part_end < end && *part_end != '-') {
+            part_end = g_utf8_next_char(part_end);
+        }
+        if (!check_part(check_word, user_data, p, part_end)) {
+            return FALSE;
+        }
+        p = part_end < end ? part_end + 1 : end;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Whether the whitespace in [ws_start, ws_end) separates two sentences: it
+ * follows a '.', '!' or '?', or contains a blank line. A single newline is
+ * not a boundary, as the composer's plain text is hard-wrapped.
+ */
+static gboolean
+is_sentence_boundary(const gchar *text, gsize ws_start, gsize ws_end)
+{
+    guint newlines = 0;
+
+    if (ws_start > 0 &&
+        (text[ws_start - 1] == '.' || text[ws_start - 1] == '!' || text[ws_start - 1] == '?')) {
+        return TRUE;
+    }
+    for (gsize i = ws_start; i < ws_end; i++) {
+        if (text[i] == '\n' && ++newlines == 2) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// Start of the sentence containing pos
+static gsize
+find_sentence_start(const gchar *text, gsize pos)
+{
+    while (pos > 0) {
+        if (g_ascii_isspace(text[pos - 1])) {
+            gsize ws_end = pos;
+            while (pos > 0 && g_ascii_isspace(text[pos - 1])) {
+                pos--;
+            }
+            if (pos == 0 || is_sentence_boundary(text, pos, ws_end)) {
+                return ws_end;
+            }
+        } else {
+            pos--;
+        }
+    }
+    return 0;
+}
+
+// End of the sentence containing pos, after its terminator
+static gsize
+find_sentence_end(const gchar *text, gsize length, gsize pos)
+{
+    while (pos < length) {
+        if (g_ascii_isspace(text[pos])) {
+            gsize ws_start = pos;
+            while (pos < length && g_ascii_isspace(text[pos])) {
+                pos++;
+            }
+            if (is_sentence_boundary(text, ws_start, pos)) {
+                return ws_start;
+            }
+        } else {
+            pos++;
+        }
+    }
+    return length;
+}
+
+/*
+ * Runs check_word (the local spell checker) over the author's own text
+ * (quoted lines and the signature are ignored).
+ *
+ * If all misspelt words are in one block of the author's lines (for an
+ * inline reply, one reply between two quotes), returns
+ * M_SPELL_PREFILTER_FOUND and sets [block_start, block_end) to that block and
+ * [span_start, span_end) to the range within it covering every sentence with
+ * a misspelt word plus one sentence of context on each side. The span never
+ * includes quoted lines.
+ */
+MSpellPrefilterResult
+m_spell_prefilter_find_span(MSpellCheckFunc check_word,
+                            gpointer user_data,
+                            const gchar *text,
+                            gsize *block_start,
+                            gsize *block_end,
+                            gsize *span_start,
+                            gsize *span_end)
+{
+    gsize length = strlen(text);
+    gsize stop = m_reply_text_find_signature(text);
+    const gchar *first_bad = NULL;
+    const gchar *last_bad = NULL;
+    const gchar *line = text;
+    const gchar *current_block = text;
+    const gchar *bad_block = NULL;
+    gboolean scattered = FALSE;
+    gsize start, end, next, b_start, b_end;
+
+    g_return_val_if_fail(check_word != NULL, M_SPELL_PREFILTER_CLEAN);
+
+    // The signature is not checked
+    while (line < text + stop) {
+        const gchar *eol = strchr(line, '\n');
+        if (!eol) {
+            eol = text + length;
+        }
+
+        // Quoted text is context, not ours to correct
+        if (*line == '>') {
+            current_block = *eol ? eol + 1 : eol;
+        } else {
+            const gchar *p = line;
+            while (p < eol) {
+                const gchar *token_start, *word_start, *word_end;
+
+                if (g_unichar_isspace(g_utf8_get_char(p))) {
+                    p = g_utf8_next_char(p);
+                    continue;
+                }
+                token_start = p;
+                while (p < eol && !g_unichar_isspace(g_utf8_get_char(p))) {
+                    p = g_utf8_next_char(p);
+                }
+                if (!check_token(check_word, user_data, token_start, p, &word_start, &word_end)) {
+                    g_debug("Misspelt word: %.*s", (int)(word_end - word_start), word_start);
+                    if (!first_bad) {
+                        first_bad = word_start;
+                        bad_block = current_block;
+                    } else if (bad_block != current_block) {
+                        scattered = TRUE;
+                    }
+                    last_bad = word_end;
+                }
+            }
+        }
+
+        line = *eol ? eol + 1 : eol;
+    }
+
+    if (!first_bad) {
+        return M_SPELL_PREFILTER_CLEAN;
+    }
+    if (scattered) {
+        g_debug("Misspelt words in several blocks, not narrowing");
+        return M_SPELL_PREFILTER_SCATTERED;
+    }
+
+    b_start = bad_block - text;
+    while (b_start < stop && g_ascii_isspace(text[b_start])) {
+        b_start++;
+    }
+    b_end = MAX(m_reply_text_find_block_end(text, b_start, stop), (gsize)(last_bad - text));
+
+    // Add the sentence before and after, skipping the whitespace between
+    start = find_sentence_start(text, first_bad - text);
+    next = start;
+    while (next > b_start && g_ascii_isspace(text[next - 1])) {
+        next--;
+    }
+    if (next > b_start) {
+        start = find_sentence_start(text, next - 1);
+    }
+    end = find_sentence_end(text, length, last_bad - text);
+    next = end;
+    while (next < b_end && g_ascii_isspace(text[next])) {
+        next++;
+    }
+    if (next < b_end) {
+        end = find_sentence_end(text, length, next);
+    }
+    start = MAX(start, b_start);
+    end = MIN(end, b_end);
+
+    // Keep surrounding whitespace out of the span so it survives splicing
+    while (start < end && g_ascii_isspace(text[start])) {
+        start++;
+    }
+    while (end > start && g_ascii_isspace(text[end - 1])) {
+        end--;
+    }
+
+    *block_start = b_start;
+    *block_end = b_end;
+    *span_start = start;
+    *span_end = end;
+
+    return M_SPELL_PREFILTER_FOUND;
+}
@@ -0,0 +1,31 @@
+#ifndef M_SPELL_PREFILTER_H
+#define M_SPELL_PREFILTER_H
+
+#include <json-glib/json-glib.h>
+
+typedef enum {
+    M_SPELL_PREFILTER_OFF,      // Always send the whole message
+    M_SPELL_PREFILTER_SKIP,     // Do not call the API if no misspelt words are found
+    M_SPELL_PREFILTER_NARROW    // Send only the sentences with misspelt words plus context
+} MSpellPrefilterMode;
+
+typedef enum {
+    M_SPELL_PREFILTER_CLEAN,      // No misspelt words
+    M_SPELL_PREFILTER_FOUND,      // Misspelt words, all in one block of the author's text
+    M_SPELL_PREFILTER_SCATTERED   // Misspelt words in several blocks, e.g. inline replies
+} MSpellPrefilterResult;
+
+// Returns FALSE if the word (length bytes, not nul-terminated) is misspelt
+typedef gboolean (*MSpellCheckFunc)(const gchar *word, gsize length, gpointer user_data);
+
+MSpellPrefilterMode m_spell_prefilter_get_mode(JsonObject *prompt);
+
+MSpellPrefilterResult m_spell_prefilter_find_span(MSpellCheckFunc check_word,
+                                                  gpointer user_data,
+                                                  const gchar *text,
+                                                  gsize *block_start,
+                                                  gsize *block_end,
+                                                  gsize *span_start,
+                                                  gsize *span_end);
+
+#endif /* M_SPELL_PREFILTER_H */
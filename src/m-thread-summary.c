@@ -0,0 +1,421 @@
+#include <string.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include "m-thread-summary.h"
+#include "m-chatgpt-api.h"
+
+/*
+ * Replies in a long thread carry the whole quoted history, which the model
+ * would otherwise re-read in full on every request. One summary is kept per
+ * thread, cached on disk under the Message-ID of the thread root together
+ * with the Message-IDs of the messages it covers, and sent in place of the
+ * quote. A later reply only adds the messages quoted since then to it.
+ */
+
+// Quotes shorter than this are cheaper to send than to summarise
+#define QUOTE_MIN_LENGTH 2000
+
+#define SUMMARY_PROMPT_NAME "Thread summary"
+#define SUMMARY_PROMPT \
+    "You summarise email threads to give context for writing a reply. " \
+    "Summarise the following quoted email thread concisely. Keep who said " \
+    "what, any questions asked, requests, decisions, dates, figures and " \
+    "names. Do not add anything that is not in the thread. Return plain " \
+    "text only."
+
+#define SUMMARY_UPDATE_PROMPT_NAME "Thread summary update"
+#define SUMMARY_UPDATE_PROMPT \
+    "You summarise email threads to give context for writing a reply. " \
+    "The input is a summary of an email thread so far, followed by the " \
+    "newer messages of the thread, quoted. Return a concise summary of the " \
+    "whole thread which adds the newer messages to the summary so far. " \
+    "Keep who said what, any questions asked, requests, decisions, dates, " \
+    "figures and names. Do not add anything that is not in the input. " \
+    "Return plain text only."
+
+G_LOCK_DEFINE_STATIC(cache);
+static gchar *cache_dir = NULL;
+
+void
+m_thread_summary_set_cache_dir(const gchar *dir)
+{
+    G_LOCK(cache);
+    g_free(cache_dir);
+    cache_dir = g_strdup(dir);
+    G_UNLOCK(cache);
+}
+
+gboolean
+m_thread_summary_wanted(JsonObject *prompt)
+{
+    // Edits are applied to the text sent, which must not contain the summary
+    return prompt &&
+           json_object_get_boolean_member_with_default(prompt, "summarize_quote", FALSE) &&
+           g_strcmp0(json_object_get_string_member_with_default(prompt, "response", NULL),
+                     "edits") != 0;
+}
+
+/*
+ * Finds the quoted block (lines starting with '>' and the attribution line
+ * just before them). Returns FALSE if there is no quote, or if the reply is
+ * interleaved with the quote, in which case the quote cannot be replaced.
+ */
+static gboolean
+find_quote(const gchar *content, gsize *quote_start, gsize *quote_end)
+{
+    const gchar *line = content;
+    const gchar *last_text = NULL;   // Last non-blank unquoted line
+    const gchar *first_quote = NULL;
+    const gchar *attribution = NULL; // Last non-blank line before the quote
+    const gchar *quote_stop = NULL;
+
+    while (*line) {
+        const gchar *eol = strchr(line, '\n');
+        const gchar *next = eol ? eol + 1 : line + strlen(line);
+
+        if (*line == '>') {
+            if (first_quote && last_text > first_quote) {
+                g_debug("Inline reply, quote not summarised");
+                return FALSE;
+            }
+            if (!first_quote) {
+                first_quote = line;
+                attribution = last_text;
+            }
+            quote_stop = next;
+        } else {
+            const gchar *p = line;
+            while (p < next && g_ascii_isspace(*p)) {
+                p++;
+            }
+            if (p < next) {
+                last_text = line;
+            }
+        }
+        line = next;
+    }
+
+    if (!first_quote) {
+        return FALSE;
+    }
+
+    // Include an attribution line such as "On ..., X wrote:"
+    if (attribution) {
+        const gchar *end = first_quote;
+        while (end > attribution && g_ascii_isspace(end[-1])) {
+            end--;
+        }
+        if (end > attribution && end[-1] == ':' && !memchr(attribution, '\n', end - attribution)) {
+            first_quote = attribution;
+        }
+    }
+
+    *quote_start = first_quote - content;
+    *quote_end = quote_stop - content;
+    return TRUE;
+}
+
+// Quoting levels of the line, e.g. 2 for "> > text" or ">> text"
+static guint
+quote_depth(const gchar *line, const gchar *end)
+{
+    guint depth = 0;
+
+    while (line < end && *line == '>') {
+        depth++;
+        line++;
+        if (line + 1 < end && line[0] == ' ' && line[1] == '>') {
+            line++;
+        }
+    }
+    return depth;
+}
+
+/*
+ * Strips one level of quoting, keeping only lines quoted fewer than
+ * max_depth levels deep (G_MAXUINT for all of them).
+ */
+static gchar *
+unquote(const gchar *quote, gsize length, guint max_depth)
+{
+    GString *text = g_string_sized_new(length);
+    const gchar *line = quote;
+    const gchar *end = quote + length;
+
+    while (line < end) {
+        const gchar *eol = memchr(line, '\n', end - line);
+        const gchar *next = eol ? eol + 1 : end;
+
+        if (quote_depth(line, next) < max_depth) {
+            if (*line == '>') {
+                line++;
+                if (line < next && *line == ' ') {
+                    line++;
+                }
+            }
+            g_string_append_len(text, line, next - line);
+        }
+        line = next;
+    }
+
+    return g_string_free(text, FALSE);
+}
+
+// Prefixes each line with "> ", ending with a newline
+static gchar *
+quote_lines(const gchar *text)
+{
+    GString *quoted = g_string_new(NULL);
+    gchar **lines = g_strsplit(text, "\n", -1);
+
+    for (gint i = 0; lines[i]; i++) {
+        // No empty last line for a trailing newline
+        if (!lines[i + 1] && !*lines[i] && i > 0) {
+            break;
+        }
+        g_string_append_printf(quoted, "> %s\n", lines[i]);
+    }
+    g_strfreev(lines);
+
+    return g_string_free(quoted, FALSE);
+}
+
+static gchar *
+cache_filename(const gchar *thread_id)
+{
+    gchar *checksum, *basename, *filename = NULL;
+
+    G_LOCK(cache);
+    if (cache_dir) {
+        checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA256, thread_id, -1);
+        basename = g_strconcat(checksum, ".json", NULL);
+        filename = g_build_filename(cache_dir, basename, NULL);
+        g_free(checksum);
+        g_free(basename);
+    }
+    G_UNLOCK(cache);
+
+    return filename;
+}
+
+/*
+ * Loads the cache entry for the thread:
+ *
+ *   { "thread_id": "<root>", "message_ids": ["<root>", ...], "summary": "..." }
+ *
+ * where "message_ids" are the messages whose text the summary covers.
+ */
+static JsonObject *
+load_entry(const gchar *filename, const gchar *thread_id)
+{
+    JsonParser *parser;
+    JsonObject *entry = NULL;
+
+    if (!g_file_test(filename, G_FILE_TEST_EXISTS)) {
+        return NULL;
+    }
+
+    parser = json_parser_new();
+    if (json_parser_load_from_file(parser, filename, NULL)) {
+        JsonNode *root = json_parser_get_root(parser);
+        if (JSON_NODE_HOLDS_OBJECT(root)) {
+            JsonObject *object = json_node_get_object(root);
+            JsonNode *ids = json_object_get_member(object, "message_ids");
+            if (g_strcmp0(json_object_get_string_member_with_default(object, "thread_id", NULL),
+                          thread_id) == 0 &&
+                json_object_get_string_member_with_default(object, "summary", NULL) &&
+                ids && JSON_NODE_HOLDS_ARRAY(ids)) {
+                entry = json_object_ref(object);
+            }
+        }
+    }
+    g_object_unref(parser);
+
+    return entry;
+}
+
+static gboolean
+entry_covers(JsonObject *entry, const gchar *message_id)
+{
+    JsonArray *ids = json_object_get_array_member(entry, "message_ids");
+
+    for (guint i = 0; i < json_array_get_length(ids); i++) {
+        if (g_strcmp0(json_array_get_string_element(ids, i), message_id) == 0) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*
+ * Saves the summary as covering the references, plus the messages the
+ * previous entry covered if the summary was added to it.
+ */
+static void
+save_entry(const gchar *filename,
+           const gchar * const *references,
+           JsonObject *previous,
+           const gchar *summary)
+{
+    JsonBuilder *builder;
+    JsonGenerator *generator;
+    JsonNode *root;
+    gchar *dirname;
+    GError *error = NULL;
+
+    dirname = g_path_get_dirname(filename);
+    g_mkdir_with_parents(dirname, 0700);
+    g_free(dirname);
+
+    builder = json_builder_new();
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "thread_id");
+    json_builder_add_string_value(builder, references[0]);
+    json_builder_set_member_name(builder, "message_ids");
+    json_builder_begin_array(builder);
+    if (previous) {
+        JsonArray *ids = json_object_get_array_member(previous, "message_ids");
+        for (guint i = 0; i < json_array_get_length(ids); i++) {
+            json_builder_add_string_value(builder, json_array_get_string_element(ids, i));
+        }
+    }
+    for (guint i = 0; references[i]; i++) {
+        if (!previous || !entry_covers(previous, references[i])) {
+            json_builder_add_string_value(builder, references[i]);
+        }
+    }
+    json_builder_end_array(builder);
+    json_builder_set_member_name(builder, "summary");
+    json_builder_add_string_value(builder, summary);
+    json_builder_end_object(builder);
+
+    root = json_builder_get_root(builder);
+    generator = json_generator_new();
+    json_generator_set_root(generator, root);
+    if (!json_generator_to_file(generator, filename, &error)) {
+        g_warning("Error saving thread summary: %s", error->message);
+        g_error_free(error);
+    }
+
+    g_object_unref(generator);
+    json_node_free(root);
+    g_object_unref(builder);
+}
+
+static gchar *
+summarise(const gchar *prompt_name,
+          const gchar *prompt_text,
+          const gchar *input,
+          const gchar *api_key,
+          GError **error)
+{
+    JsonArray *prompts = json_array_new();
+    JsonObject *prompt = json_object_new();
+    gchar *summary;
+
+    json_object_set_string_member(prompt, "name", prompt_name);
+    json_object_set_string_member(prompt, "prompt", prompt_text);
+    json_array_add_object_element(prompts, prompt);
+
+    summary = m_chatgpt_proofread(input, prompt_name, prompts, api_key, error);
+    if (!summary && error && !*error) {
+        // No choices, or null content
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Empty summary response");
+    }
+
+    json_array_unref(prompts);
+    return summary;
+}
+
+/*
+ * Returns the content with the quoted thread replaced by its summary, or a
+ * copy of the content if there is nothing worth summarising. references are
+ * the Message-IDs of the thread from its root to the message replied to.
+ *
+ * The message replied to is quoted one level deep, its parent two levels
+ * deep and so on. If the cached summary of the thread covers the message
+ * replied to, it is used as is. If it covers an earlier one, only the
+ * messages quoted above that level are added to it. Otherwise the whole
+ * quote is summarised. Returns NULL and sets error if the quote could not
+ * be summarised.
+ */
+gchar *
+m_thread_summary_condense(const gchar *content,
+                          const gchar * const *references,
+                          const gchar *api_key,
+                          GError **error)
+{
+    guint n_references = references ? g_strv_length((gchar **)references) : 0;
+    guint new_depth = G_MAXUINT;  // Quoting levels not covered by the cached summary
+    gsize quote_start, quote_end;
+    JsonObject *entry = NULL;
+    gchar *filename, *summary, *quote, *quoted, *prefix, *result;
+
+    if (n_references == 0 ||
+        !find_quote(content, &quote_start, &quote_end) ||
+        quote_end - quote_start < QUOTE_MIN_LENGTH) {
+        return g_strdup(content);
+    }
+
+    filename = cache_filename(references[0]);
+    entry = filename ? load_entry(filename, references[0]) : NULL;
+    for (guint depth = 1; entry && depth <= n_references; depth++) {
+        if (entry_covers(entry, references[n_references - depth])) {
+            new_depth = depth;
+            break;
+        }
+    }
+
+    if (new_depth == 1) {
+        g_debug("Using cached summary for %s", references[0]);
+        summary = g_strdup(json_object_get_string_member(entry, "summary"));
+    } else if (new_depth != G_MAXUINT) {
+        gchar *input;
+
+        quote = unquote(content + quote_start, quote_end - quote_start, new_depth);
+        g_debug("Adding %" G_GSIZE_FORMAT " bytes of newer messages to the summary for %s",
+                strlen(quote), references[0]);
+        input = g_strconcat("Summary so far:\n", json_object_get_string_member(entry, "summary"),
+                            "\n\nNewer messages:\n", quote, NULL);
+        summary = summarise(SUMMARY_UPDATE_PROMPT_NAME, SUMMARY_UPDATE_PROMPT,
+                            input, api_key, error);
+        g_free(input);
+        g_free(quote);
+    } else {
+        // Nothing quoted is covered: replace any summary of another branch
+        g_clear_pointer(&entry, json_object_unref);
+        quote = unquote(content + quote_start, quote_end - quote_start, G_MAXUINT);
+        g_debug("Summarising %" G_GSIZE_FORMAT " bytes of quote for %s",
+                quote_end - quote_start, references[0]);
+        summary = summarise(SUMMARY_PROMPT_NAME, SUMMARY_PROMPT, quote, api_key, error);
+        g_free(quote);
+    }
+
+    if (!summary) {
+        if (entry) {
+            json_object_unref(entry);
+        }
+        g_free(filename);
+        return NULL;
+    }
+    if (new_depth != 1 && filename) {
+        save_entry(filename, references, entry, summary);
+    }
+
+    // Quoted like the text it replaces, so it is not taken for the author's
+    quoted = quote_lines(summary);
+    prefix = g_strndup(content, quote_start);
+    result = g_strconcat(prefix,
+                         "> [Summary of the quoted thread]\n", quoted,
+                         content + quote_end, NULL);
+
+    g_free(quoted);
+    g_free(prefix);
+    g_free(summary);
+    g_free(filename);
+    if (entry) {
+        json_object_unref(entry);
+    }
+
+    return result;
+}
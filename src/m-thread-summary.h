@@ -0,0 +1,15 @@
+#ifndef M_THREAD_SUMMARY_H
+#define M_THREAD_SUMMARY_H
+
+#include <json-glib/json-glib.h>
+
+void m_thread_summary_set_cache_dir(const gchar *cache_dir);
+
+gboolean m_thread_summary_wanted(JsonObject *prompt);
+
+gchar *m_thread_summary_condense(const gchar *content,
+                                 const gchar * const *references,
+                                 const gchar *api_key,
+                                 GError **error);
+
+#endif /* M_THREAD_SUMMARY_H */
@@ -0,0 +1,227 @@
+#include <glib/gstdio.h>
+#include "m-transport.h"
+
+#define READ_CHUNK_SIZE 8192
+
+/*
+ * Exchanges are recorded as:
+ *
+ *   {
+ *     "request": { "method": ..., "url": ..., "headers": {...}, "body": ... },
+ *     "response": {
+ *       "status": 200, "reason": "OK", "headers": {...},
+ *       "chunks": [ { "delay_us": 812345, "data": "<base64>" }, ... ]
+ *     },
+ *     "error": "...",      // only if the transfer failed
+ *     "timed_out": false   // whether it failed by timing out
+ *   }
+ *
+ * where "delay_us" is the time since the request was sent (first chunk) or
+ * since the previous chunk was received. Credentials are never written.
+ */
+
+static gboolean
+is_secret_header(const gchar *name)
+{
+    return g_ascii_strcasecmp(name, "Authorization") == 0 ||
+           g_ascii_strcasecmp(name, "Cookie") == 0 ||
+           g_ascii_strcasecmp(name, "Set-Cookie") == 0;
+}
+
+static void
+add_headers(JsonBuilder *builder, SoupMessageHeaders *headers)
+{
+    SoupMessageHeadersIter iter;
+    const char *name, *value;
+
+    json_builder_begin_object(builder);
+    soup_message_headers_iter_init(&iter, headers);
+    while (soup_message_headers_iter_next(&iter, &name, &value)) {
+        json_builder_set_member_name(builder, name);
+        json_builder_add_string_value(builder, is_secret_header(name) ? "REDACTED" : value);
+    }
+    json_builder_end_object(builder);
+}
+
+static void
+write_recording(const gchar *record_dir,
+                SoupMessage *msg,
+                const gchar *request_body,
+                JsonArray *chunks,
+                const GError *transfer_error)
+{
+    JsonBuilder *builder;
+    JsonGenerator *generator;
+    JsonNode *root;
+    GDateTime *now;
+    gchar *basename, *filename, *url;
+    GError *error = NULL;
+
+    builder = json_builder_new();
+    json_builder_begin_object(builder);
+
+    json_builder_set_member_name(builder, "request");
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "method");
+    json_builder_add_string_value(builder, soup_message_get_method(msg));
+    json_builder_set_member_name(builder, "url");
+    url = g_uri_to_string(soup_message_get_uri(msg));
+    json_builder_add_string_value(builder, url);
+    g_free(url);
+    json_builder_set_member_name(builder, "headers");
+    add_headers(builder, soup_message_get_request_headers(msg));
+    json_builder_set_member_name(builder, "body");
+    json_builder_add_string_value(builder, request_body);
+    json_builder_end_object(builder);
+
+    json_builder_set_member_name(builder, "response");
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "status");
+    json_builder_add_int_value(builder, soup_message_get_status(msg));
+    json_builder_set_member_name(builder, "reason");
+    // NULL if no response arrived at all
+    if (soup_message_get_reason_phrase(msg)) {
+        json_builder_add_string_value(builder, soup_message_get_reason_phrase(msg));
+    } else {
+        json_builder_add_null_value(builder);
+    }
+    json_builder_set_member_name(builder, "headers");
+    add_headers(builder, soup_message_get_response_headers(msg));
+    json_builder_set_member_name(builder, "chunks");
+    root = json_node_new(JSON_NODE_ARRAY);
+    json_node_take_array(root, chunks);
+    json_builder_add_value(builder, root);  // Takes ownership
+    json_builder_end_object(builder);
+
+    if (transfer_error) {
+        json_builder_set_member_name(builder, "error");
+        json_builder_add_string_value(builder, transfer_error->message);
+        json_builder_set_member_name(builder, "timed_out");
+        json_builder_add_boolean_value(builder,
+            g_error_matches(transfer_error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT));
+    }
+
+    json_builder_end_object(builder);
+
+    g_mkdir_with_parents(record_dir, 0700);
+    now = g_date_time_new_now_local();
+    basename = g_date_time_format(now, "%Y%m%d-%H%M%S-%f.json");
+    filename = g_build_filename(record_dir, basename, NULL);
+    g_date_time_unref(now);
+    g_free(basename);
+
+    root = json_builder_get_root(builder);
+    generator = json_generator_new();
+    json_generator_set_pretty(generator, TRUE);
+    json_generator_set_root(generator, root);
+    if (json_generator_to_file(generator, filename, &error)) {
+        g_debug("Recorded exchange to %s", filename);
+    } else {
+        g_warning("Error recording exchange: %s", error->message);
+        g_error_free(error);
+    }
+
+    g_object_unref(generator);
+    json_node_free(root);
+    g_object_unref(builder);
+    g_free(filename);
+}
+
+/*
+ * Sends the message and reads the whole response body, like
+ * soup_session_send_and_read(). If M_TRANSPORT_RECORD_ENV names a directory,
+ * the exchange is recorded there with the arrival time of each chunk.
+ */
+GBytes *
+m_transport_send(SoupSession *session,
+                 SoupMessage *msg,
+                 const gchar *request_body,
+                 GError **error)
+{
+    const gchar *record_dir = g_getenv(M_TRANSPORT_RECORD_ENV);
+    JsonArray *chunks = record_dir && *record_dir ? json_array_new() : NULL;
+    GByteArray *data = g_byte_array_new();
+    GInputStream *stream;
+    GError *local_error = NULL;
+    gint64 last_time = g_get_monotonic_time();
+
+    stream = soup_session_send(session, msg, NULL, &local_error);
+    while (stream) {
+        GBytes *chunk = g_input_stream_read_bytes(stream, READ_CHUNK_SIZE, NULL, &local_error);
+        gint64 now = g_get_monotonic_time();
+        const guint8 *bytes;
+        gsize length;
+
+        if (!chunk) {
+            break;
+        }
+        bytes = g_bytes_get_data(chunk, &length);
+        if (length == 0) {
+            g_bytes_unref(chunk);
+            break;
+        }
+
+        g_byte_array_append(data, bytes, length);
+        if (chunks) {
+            JsonObject *entry = json_object_new();
+            gchar *encoded = g_base64_encode(bytes, length);
+            json_object_set_int_member(entry, "delay_us", now - last_time);
+            json_object_set_string_member(entry, "data", encoded);
+            json_array_add_object_element(chunks, entry);
+            g_free(encoded);
+        }
+        last_time = now;
+        g_bytes_unref(chunk);
+    }
+
+    if (stream) {
+        g_input_stream_close(stream, NULL, NULL);
+        g_object_unref(stream);
+    }
+
+    if (chunks) {
+        write_recording(record_dir, msg, request_body, chunks, local_error);
+    }
+
+    if (local_error) {
+        g_propagate_error(error, local_error);
+        g_byte_array_unref(data);
+        return NULL;
+    }
+
+    return g_byte_array_free_to_bytes(data);
+}
+
+JsonObject *
+m_transport_load_recording(const gchar *filename,
+                           GError **error)
+{
+    JsonParser *parser;
+    JsonNode *root, *response;
+    JsonObject *recording = NULL;
+
+    parser = json_parser_new();
+    if (!json_parser_load_from_file(parser, filename, error)) {
+        g_object_unref(parser);
+        return NULL;
+    }
+
+    root = json_parser_get_root(parser);
+    if (JSON_NODE_HOLDS_OBJECT(root)) {
+        response = json_object_get_member(json_node_get_object(root), "response");
+        if (response && JSON_NODE_HOLDS_OBJECT(response)) {
+            JsonNode *chunks = json_object_get_member(json_node_get_object(response), "chunks");
+            if (chunks && JSON_NODE_HOLDS_ARRAY(chunks)) {
+                recording = json_object_ref(json_node_get_object(root));
+            }
+        }
+    }
+
+    if (!recording) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "Invalid recording %s: no response chunks array", filename);
+    }
+
+    g_object_unref(parser);
+    return recording;
+}
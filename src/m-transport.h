@@ -0,0 +1,18 @@
+#ifndef M_TRANSPORT_H
+#define M_TRANSPORT_H
+
+#include <libsoup/soup.h>
+#include <json-glib/json-glib.h>
+
+// Directory to record API exchanges to, one JSON file per request
+#define M_TRANSPORT_RECORD_ENV "AI_PROOFREAD_RECORD"
+
+GBytes *m_transport_send(SoupSession *session,
+                         SoupMessage *msg,
+                         const gchar *request_body,
+                         GError **error);
+
+JsonObject *m_transport_load_recording(const gchar *filename,
+                                       GError **error);
+
+#endif /* M_TRANSPORT_H */
@@ -0,0 +1,162 @@
+#include <glib/gstdio.h>
+#include "m-usage-stats.h"
+
+/*
+ * Per-prompt usage counters, accumulated over all requests and kept in a
+ * JSON file so that the effect of prompt options can be compared over time:
+ *
+ *   { "Proofread": { "requests": 12, "elapsed_ms": 10345, ... }, ... }
+ */
+
+G_LOCK_DEFINE_STATIC(stats);
+static gchar *stats_filename = NULL;
+static JsonObject *stats = NULL;
+
+// Counters copied from the API "usage" object: {stats key, usage member, details member}
+static const struct {
+    const gchar *key;
+    const gchar *member;
+    const gchar *detail;
+} usage_counters[] = {
+    { "prompt_tokens", "prompt_tokens", NULL },
+    { "cached_prompt_tokens", "prompt_tokens_details", "cached_tokens" },
+    { "completion_tokens", "completion_tokens", NULL },
+    { "accepted_prediction_tokens", "completion_tokens_details", "accepted_prediction_tokens" },
+    { "rejected_prediction_tokens", "completion_tokens_details", "rejected_prediction_tokens" }
+};
+
+void
+m_usage_stats_set_filename(const gchar *filename)
+{
+    G_LOCK(stats);
+    g_free(stats_filename);
+    stats_filename = g_strdup(filename);
+    g_clear_pointer(&stats, json_object_unref);
+    G_UNLOCK(stats);
+}
+
+static void
+load_stats(void)
+{
+    JsonParser *parser;
+    GError *error = NULL;
+
+    if (stats) {
+        return;
+    }
+
+    if (stats_filename && g_file_test(stats_filename, G_FILE_TEST_EXISTS)) {
+        parser = json_parser_new();
+        if (json_parser_load_from_file(parser, stats_filename, &error)) {
+            JsonNode *root = json_parser_get_root(parser);
+            if (JSON_NODE_HOLDS_OBJECT(root)) {
+                stats = json_object_ref(json_node_get_object(root));
+            }
+        } else {
+            g_warning("Error loading usage stats: %s", error->message);
+            g_error_free(error);
+        }
+        g_object_unref(parser);
+    }
+
+    if (!stats) {
+        stats = json_object_new();
+    }
+}
+
+static void
+save_stats(void)
+{
+    JsonGenerator *generator;
+    JsonNode *root;
+    gchar *dirname;
+    GError *error = NULL;
+
+    if (!stats_filename) {
+        return;
+    }
+
+    dirname = g_path_get_dirname(stats_filename);
+    g_mkdir_with_parents(dirname, 0700);
+    g_free(dirname);
+
+    root = json_node_new(JSON_NODE_OBJECT);
+    json_node_set_object(root, stats);
+    generator = json_generator_new();
+    json_generator_set_pretty(generator, TRUE);
+    json_generator_set_root(generator, root);
+    if (!json_generator_to_file(generator, stats_filename, &error)) {
+        g_warning("Error saving usage stats: %s", error->message);
+        g_error_free(error);
+    }
+    g_object_unref(generator);
+    json_node_free(root);
+}
+
+static void
+add_counter(JsonObject *entry, const gchar *key, gint64 value)
+{
+    json_object_set_int_member(entry, key,
+        json_object_get_int_member_with_default(entry, key, 0) + value);
+}
+
+void
+m_usage_stats_record(const gchar *prompt_name,
+                     JsonObject *usage,
+                     gint64 elapsed_us)
+{
+    JsonObject *entry;
+
+    g_return_if_fail(prompt_name != NULL);
+
+    G_LOCK(stats);
+    load_stats();
+
+    if (!json_object_has_member(stats, prompt_name)) {
+        json_object_set_object_member(stats, prompt_name, json_object_new());
+    }
+    entry = json_object_get_object_member(stats, prompt_name);
+
+    add_counter(entry, "requests", 1);
+    add_counter(entry, "elapsed_ms", elapsed_us / 1000);
+
+    for (guint i = 0; usage && i < G_N_ELEMENTS(usage_counters); i++) {
+        JsonObject *source = usage;
+        const gchar *member = usage_counters[i].member;
+
+        if (usage_counters[i].detail) {
+            JsonNode *node = json_object_get_member(usage, member);
+            if (!node || !JSON_NODE_HOLDS_OBJECT(node)) {
+                continue;
+            }
+            source = json_node_get_object(node);
+            member = usage_counters[i].detail;
+        }
+        add_counter(entry, usage_counters[i].key,
+                    json_object_get_int_member_with_default(source, member, 0));
+    }
+
+    // Prompt tokens which were not served from the provider's prompt cache
+    if (usage) {
+        JsonNode *details = json_object_get_member(usage, "prompt_tokens_details");
+        gint64 cached = details && JSON_NODE_HOLDS_OBJECT(details) ?
+            json_object_get_int_member_with_default(json_node_get_object(details),
+                                                    "cached_tokens", 0) : 0;
+        add_counter(entry, "uncached_prompt_tokens",
+                    json_object_get_int_member_with_default(usage, "prompt_tokens", 0) - cached);
+    }
+
+    g_debug("Usage for %s: %" G_GINT64_FORMAT " requests, %" G_GINT64_FORMAT " ms, "
+            "%" G_GINT64_FORMAT " cached / %" G_GINT64_FORMAT " uncached prompt tokens, "
+            "%" G_GINT64_FORMAT " accepted / %" G_GINT64_FORMAT " rejected prediction tokens",
+            prompt_name,
+            json_object_get_int_member(entry, "requests"),
+            json_object_get_int_member(entry, "elapsed_ms"),
+            json_object_get_int_member_with_default(entry, "cached_prompt_tokens", 0),
+            json_object_get_int_member_with_default(entry, "uncached_prompt_tokens", 0),
+            json_object_get_int_member_with_default(entry, "accepted_prediction_tokens", 0),
+            json_object_get_int_member_with_default(entry, "rejected_prediction_tokens", 0));
+
+    save_stats();
+    G_UNLOCK(stats);
+}
@@ -0,0 +1,12 @@
+#ifndef M_USAGE_STATS_H
+#define M_USAGE_STATS_H
+
+#include <json-glib/json-glib.h>
+
+void m_usage_stats_set_filename(const gchar *filename);
+
+void m_usage_stats_record(const gchar *prompt_name,
+                          JsonObject *usage,
+                          gint64 elapsed_us);
+
+#endif /* M_USAGE_STATS_H */
@@ -0,0 +1,120 @@
+/*
+ * Tests for m_edit_list_apply(): locating anchored edits in the original
+ * text and rejecting edit lists which do not match it.
+ */
+
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+
+#include "m-edit-list.h"
+
+static void
+assert_applies(const gchar *text, const gchar *edits_json, const gchar *expected)
+{
+    GError *error = NULL;
+    gchar *result = m_edit_list_apply(text, edits_json, &error);
+
+    g_assert_no_error(error);
+    g_assert_cmpstr(result, ==, expected);
+    g_free(result);
+}
+
+static void
+assert_rejects(const gchar *text, const gchar *edits_json)
+{
+    GError *error = NULL;
+    gchar *result = m_edit_list_apply(text, edits_json, &error);
+
+    g_assert_null(result);
+    g_assert_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+    g_error_free(error);
+}
+
+static void
+test_empty(void)
+{
+    assert_applies("I has a cat.", "{\"edits\": []}", "I has a cat.");
+}
+
+static void
+test_anchored(void)
+{
+    // The anchor picks the second "has", not the first
+    assert_applies("I has a cat. He has a dog.",
+                   "{\"edits\": [{\"before\": \"He \", \"original\": \"has\", \"replacement\": \"had\"}]}",
+                   "I has a cat. He had a dog.");
+    assert_applies("I has a cat. He has a dog.",
+                   "{\"edits\": ["
+                   "{\"before\": \"I \", \"original\": \"has\", \"replacement\": \"have\"},"
+                   "{\"before\": \"He \", \"original\": \"has\", \"replacement\": \"had\"}]}",
+                   "I have a cat. He had a dog.");
+}
+
+static void
+test_insertion(void)
+{
+    assert_applies("a cat",
+                   "{\"edits\": [{\"before\": \"a\", \"original\": \"\", \"replacement\": \" big\"}]}",
+                   "a big cat");
+    // Empty "before" and "original" insert at the very start
+    assert_applies("a cat",
+                   "{\"edits\": [{\"before\": \"\", \"original\": \"\", \"replacement\": \"Hi. \"},"
+                   "{\"before\": \"a \", \"original\": \"cat\", \"replacement\": \"dog\"}]}",
+                   "Hi. a dog");
+}
+
+static void
+test_overlapping_anchor(void)
+{
+    // The second anchor includes the text replaced by the first edit
+    assert_applies("teh teh cat",
+                   "{\"edits\": ["
+                   "{\"before\": \"\", \"original\": \"teh\", \"replacement\": \"the\"},"
+                   "{\"before\": \"teh \", \"original\": \"teh\", \"replacement\": \"the\"}]}",
+                   "the the cat");
+}
+
+static void
+test_reject(void)
+{
+    // Not in the text, and must not match inside "bits" or "tehran"
+    assert_rejects("bits of it",
+                   "{\"edits\": [{\"before\": \"of \", \"original\": \"its\", \"replacement\": \"it's\"}]}");
+    assert_rejects("bits of it",
+                   "{\"edits\": [{\"before\": \"\", \"original\": \"its\", \"replacement\": \"it's\"}]}");
+    assert_rejects("I visited tehran",
+                   "{\"edits\": [{\"before\": \"visited \", \"original\": \"teh\", \"replacement\": \"the\"}]}");
+    // Part of a word, with and without a "before" anchor
+    assert_rejects("I recieve it",
+                   "{\"edits\": [{\"before\": \"\", \"original\": \"ie\", \"replacement\": \"ei\"}]}");
+    assert_rejects("I recieve it",
+                   "{\"edits\": [{\"before\": \"I rec\", \"original\": \"ie\", \"replacement\": \"ei\"}]}");
+    // Out of order
+    assert_rejects("one two",
+                   "{\"edits\": ["
+                   "{\"before\": \"one \", \"original\": \"two\", \"replacement\": \"2\"},"
+                   "{\"before\": \"\", \"original\": \"one\", \"replacement\": \"1\"}]}");
+    // Insertion at the start after another edit
+    assert_rejects("one two",
+                   "{\"edits\": ["
+                   "{\"before\": \"one \", \"original\": \"two\", \"replacement\": \"2\"},"
+                   "{\"before\": \"\", \"original\": \"\", \"replacement\": \"0 \"}]}");
+    // Malformed
+    assert_rejects("one two", "{\"edits\": [{\"original\": \"two\"}]}");
+    assert_rejects("one two", "{\"changes\": []}");
+    assert_rejects("one two", NULL);
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/edit-list/empty", test_empty);
+    g_test_add_func("/edit-list/anchored", test_anchored);
+    g_test_add_func("/edit-list/insertion", test_insertion);
+    g_test_add_func("/edit-list/overlapping-anchor", test_overlapping_anchor);
+    g_test_add_func("/edit-list/reject", test_reject);
+
+    return g_test_run();
+}
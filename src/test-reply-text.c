@@ -0,0 +1,93 @@
+/*
+ * Tests for finding the author's text in a plain-text reply: the single
+ * block of a top- or bottom-posted reply, and the author's lines of any
+ * reply without quote, attribution and signature.
+ */
+
+#include <glib.h>
+
+#include "m-reply-text.h"
+
+static void
+assert_block(const gchar *text, const gchar *expected)
+{
+    gsize block_start, block_end;
+    gchar *block;
+
+    g_assert_true(m_reply_text_find_author_block(text, &block_start, &block_end));
+    block = g_strndup(text + block_start, block_end - block_start);
+    g_assert_cmpstr(block, ==, expected);
+    g_free(block);
+}
+
+static void
+assert_no_block(const gchar *text)
+{
+    gsize block_start, block_end;
+
+    g_assert_false(m_reply_text_find_author_block(text, &block_start, &block_end));
+}
+
+static void
+assert_author_text(const gchar *text, const gchar *expected)
+{
+    gchar *author_text = m_reply_text_get_author_text(text);
+
+    g_assert_cmpstr(author_text, ==, expected);
+    g_free(author_text);
+}
+
+static void
+test_signature(void)
+{
+    g_assert_cmpuint(m_reply_text_find_signature("Hi.\n-- \nJohn\n"), ==, 4);
+    g_assert_cmpuint(m_reply_text_find_signature("Hi.\n-- \r\nJohn\n"), ==, 4);
+    g_assert_cmpuint(m_reply_text_find_signature("Hi.\n-- "), ==, 4);
+    // Not a separator without the trailing space
+    g_assert_cmpuint(m_reply_text_find_signature("Hi.\n--\nJohn"), ==, 11);
+}
+
+static void
+test_block(void)
+{
+    assert_block("Hi Bob,\n\nYes, fine.\n\n-- \nJohn\n", "Hi Bob,\n\nYes, fine.");
+    // Top-posted, the attribution belongs to the quote
+    assert_block("Yes, fine.\n\nOn Mon, Bob wrote:\n> Is it fine?\n> Bob\n\n-- \nJohn\n",
+                 "Yes, fine.");
+    // Bottom-posted
+    assert_block("On Mon, Bob wrote:\n> Is it fine?\n\nYes, fine.\n\n-- \nJohn\n",
+                 "Yes, fine.");
+    // A colon in the author's own text
+    assert_block("Two things:\n\nfirst, second.\n", "Two things:\n\nfirst, second.");
+}
+
+static void
+test_no_block(void)
+{
+    assert_no_block("On Mon, Bob wrote:\n> One?\nYes.\n> Two?\nNo.\n");
+    assert_no_block("> Only a quote\n\n-- \nJohn\n");
+    assert_no_block("");
+}
+
+static void
+test_author_text(void)
+{
+    assert_author_text("Yes, fine.\n\nOn Mon, Bob wrote:\n> Is it fine?\n\n-- \nJohn\n",
+                       "Yes, fine.");
+    assert_author_text("On Mon, Bob wrote:\n> One?\nYes.\n> Two?\nNo.\n-- \nJohn\n",
+                       "Yes.\nNo.");
+    assert_author_text("> Only a quote\n", "");
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/reply-text/signature", test_signature);
+    g_test_add_func("/reply-text/block", test_block);
+    g_test_add_func("/reply-text/no-block", test_no_block);
+    g_test_add_func("/reply-text/author-text", test_author_text);
+
+    return g_test_run();
+}
@@ -0,0 +1,120 @@
+/*
+ * Tests for m_spell_prefilter_find_span(): finding the author's block and
+ * the sentences around misspelt words, with a stub spell checker.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "m-spell-prefilter.h"
+
+static const gchar *misspellings[] = { "hav", "teh", NULL };
+
+static gboolean
+stub_check_word(const gchar *word, gsize length, gpointer user_data)
+{
+    for (gint i = 0; misspellings[i]; i++) {
+        if (strlen(misspellings[i]) == length && strncmp(misspellings[i], word, length) == 0) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void
+assert_span(const gchar *text, const gchar *expected_block, const gchar *expected_span)
+{
+    gsize block_start, block_end, span_start, span_end;
+    gchar *block, *span;
+
+    g_assert_cmpint(m_spell_prefilter_find_span(stub_check_word, NULL, text,
+                                                &block_start, &block_end,
+                                                &span_start, &span_end),
+                    ==, M_SPELL_PREFILTER_FOUND);
+
+    block = g_strndup(text + block_start, block_end - block_start);
+    span = g_strndup(text + span_start, span_end - span_start);
+    g_assert_cmpstr(block, ==, expected_block);
+    g_assert_cmpstr(span, ==, expected_span);
+    g_free(block);
+    g_free(span);
+}
+
+static void
+assert_result(const gchar *text, MSpellPrefilterResult expected)
+{
+    gsize block_start, block_end, span_start, span_end;
+
+    g_assert_cmpint(m_spell_prefilter_find_span(stub_check_word, NULL, text,
+                                                &block_start, &block_end,
+                                                &span_start, &span_end),
+                    ==, expected);
+}
+
+static void
+test_context(void)
+{
+    // One sentence of context on each side, across line ends
+    assert_span("Hello Bob.\nI hav a cat.\nSee you.",
+                "Hello Bob.\nI hav a cat.\nSee you.",
+                "Hello Bob.\nI hav a cat.\nSee you.");
+    assert_span("First one. Second one. I hav\na cat. Fourth one. Fifth one.",
+                "First one. Second one. I hav\na cat. Fourth one. Fifth one.",
+                "Second one. I hav\na cat. Fourth one.");
+}
+
+static void
+test_wrapped(void)
+{
+    // A single newline inside a paragraph does not end a sentence
+    assert_span("First one. This sentence\nhas teh typo. Second one. Third one.",
+                "First one. This sentence\nhas teh typo. Second one. Third one.",
+                "First one. This sentence\nhas teh typo. Second one.");
+    // A blank line does, even without a full stop
+    assert_span("Hi Bob\n\nI hav a cat\n\nCheers",
+                "Hi Bob\n\nI hav a cat\n\nCheers",
+                "Hi Bob\n\nI hav a cat\n\nCheers");
+    assert_span("Hi Bob\n\nOne. Two. I hav a cat. Three. Four.",
+                "Hi Bob\n\nOne. Two. I hav a cat. Three. Four.",
+                "Two. I hav a cat. Three.");
+}
+
+static void
+test_block(void)
+{
+    // Bottom-posted reply: the quote, its attribution and the signature are left out
+    assert_span("On Mon, Bob wrote:\n> I hav a dog.\n\nI hav a cat. Nice.\n\n-- \nJohn\n",
+                "I hav a cat. Nice.",
+                "I hav a cat. Nice.");
+    // Top-posted reply
+    assert_span("I hav a cat.\n\nOn Mon, Bob wrote:\n> Hello.\n",
+                "I hav a cat.",
+                "I hav a cat.");
+    // Inline reply: only the part between the quotes
+    assert_span("> Question one?\nYes. I hav a cat.\n> Question two?\nNo.\n",
+                "Yes. I hav a cat.",
+                "Yes. I hav a cat.");
+}
+
+static void
+test_result(void)
+{
+    // Quoted lines and the signature are not checked
+    assert_result("All fine here.\n> I hav a dog.\n", M_SPELL_PREFILTER_CLEAN);
+    assert_result("All fine.\n-- \nhav\n", M_SPELL_PREFILTER_CLEAN);
+    // Misspelt words in two inline replies
+    assert_result("I hav a cat.\n> Quote.\nSee teh end.\n", M_SPELL_PREFILTER_SCATTERED);
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/spell-prefilter/context", test_context);
+    g_test_add_func("/spell-prefilter/wrapped", test_wrapped);
+    g_test_add_func("/spell-prefilter/block", test_block);
+    g_test_add_func("/spell-prefilter/result", test_result);
+
+    return g_test_run();
+}